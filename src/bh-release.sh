@@ -5,8 +5,8 @@
 # Author:   Alastair Hughes
 # Contact:  hobbitalastair at yandex dot com
 
-SERVICE_DIR="/usr/lib/backhand"
-SERVICE_RUNDIR="/run/backhand"
+[ -z "${SERVICE_DIR}" ] && SERVICE_DIR="/usr/lib/backhand"
+[ -z "${SERVICE_RUNDIR}" ] && SERVICE_RUNDIR="/run/backhand"
 
 if [ $# != 1 ]; then
     printf "usage: bh-release <service>\n" 1>&2
@@ -30,13 +30,13 @@ fi
 
 semaphore "${service_rundir}/require" -
 err="$?"
-if [ "${err}" == 0 ]; then
+if [ "${err}" = 0 ]; then
     bh-stop "${service}"
     if [ "$?" -ne 0 ]; then
         printf '%s: failed to stop service %s\n' "$0" "${service}" 1>&2
         exit 1
     fi
-elif [ "${err}" == 2 ]; then
+elif [ "${err}" = 2 ]; then
     printf '%s: failed to decrement require count\n' "$0" 1>&2
     exit 1
 fi
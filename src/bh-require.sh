@@ -5,8 +5,8 @@
 # Author:   Alastair Hughes
 # Contact:  hobbitalastair at yandex dot com
 
-SERVICE_DIR="/usr/lib/backhand"
-SERVICE_RUNDIR="/run/backhand"
+[ -z "${SERVICE_DIR}" ] && SERVICE_DIR="/usr/lib/backhand"
+[ -z "${SERVICE_RUNDIR}" ] && SERVICE_RUNDIR="/run/backhand"
 
 if [ $# != 1 ]; then
     printf "usage: bh-require <service>\n" 1>&2
@@ -33,13 +33,13 @@ fi
 
 semaphore "${service_rundir}/require" +
 err="$?"
-if [ "${err}" == 0 ]; then
+if [ "${err}" = 0 ]; then
     bh-start "${service}"
     if [ "$?" -ne 0 ]; then
         printf '%s: failed to start service %s\n' "$0" "${service}" 1>&2
         exit 1
     fi
-elif [ "${err}" == 2 ]; then
+elif [ "${err}" = 2 ]; then
     printf '%s: failed to increment require count\n' "$0" 1>&2
     exit 1
 fi
@@ -10,6 +10,7 @@
 [ -z "${SERVICE_LOGDIR}" ] && SERVICE_LOGDIR="/var/log/backhand"
 SERVICE_PRE="pre"
 SERVICE_RUN="run"
+SERVICE_PROBES="probes"
 SERVICE_TIMEOUT=10
 
 if [ $# != 1 ]; then
@@ -44,10 +45,10 @@ fi
 service_state="${service_rundir}/state"
 state "${service_state}" "started"
 ret="$?"
-if [ "${ret}" == 2 ]; then
+if [ "${ret}" = 2 ]; then
     printf "%s: updating the state failed\n" "$0" 1>&2
     exit 1
-elif [ "${ret}" == 0 ]; then
+elif [ "${ret}" = 0 ]; then
 
     if [ -x "${service_dir}/${SERVICE_PRE}" ]; then
         @TIMEOUTCMD@ "${SERVICE_TIMEOUT}" "${service_dir}/${SERVICE_PRE}" \
@@ -61,7 +62,19 @@ elif [ "${ret}" == 0 ]; then
 
     if [ -x "${service_dir}/${SERVICE_RUN}" ]; then
         socket="${service_rundir}/socket"
-        escort "${socket}" "${service_dir}/${SERVICE_RUN}" \
+
+        # Each non-empty, non-comment line is an escort probe description.
+        set --
+        if [ -r "${service_dir}/${SERVICE_PROBES}" ]; then
+            while read -r probe || [ -n "${probe}" ]; do
+                case "${probe}" in
+                    ''|'#'*) ;;
+                    *) set -- "$@" -p "${probe}";;
+                esac
+            done < "${service_dir}/${SERVICE_PROBES}"
+        fi
+
+        escort "$@" "${socket}" "${service_dir}/${SERVICE_RUN}" \
             "${service_target}" >> "${service_log}" 2>&1
         if [ "$?" != 0 ]; then
             printf "%s: run failed\n" "$0" 1>&2
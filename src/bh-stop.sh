@@ -41,10 +41,10 @@ fi
 service_state="${service_rundir}/state"
 state "${service_state}" "stopped"
 ret="$?"
-if [ "${ret}" == 2 ]; then
+if [ "${ret}" = 2 ]; then
     printf "%s: updating the state failed\n" "$0" 1>&2
     exit 1
-elif [ "${ret}" == 0 ]; then
+elif [ "${ret}" = 0 ]; then
 
     if [ -x "${service_dir}/${SERVICE_RUN}" ]; then
         socket="${service_rundir}/socket"
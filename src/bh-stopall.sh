@@ -5,7 +5,7 @@
 # Author:   Alastair Hughes
 # Contact:  hobbitalastair at yandex dot com
 
-SERVICE_RUNDIR="/run/backhand/"
+[ -z "${SERVICE_RUNDIR}" ] && SERVICE_RUNDIR="/run/backhand"
 
 # FIXME: Services should be stopped in parallel.
 
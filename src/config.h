@@ -29,3 +29,10 @@
  */
 #define SOCK_PATHLEN 92
 
+
+/* WATCHDOG_ENV is the name of the environment variable used to pass the
+ * watchdog fd to the child.
+ *
+ * The child should write to this fd at least once every watchdog timeout.
+ */
+#define WATCHDOG_ENV "WATCHDOG_FD"
@@ -4,10 +4,27 @@
  * This provides a unix domain socket for shutting down the process, and will
  * restart the process when it is supposed to be running.
  *
+ * Optionally, a number of liveness probes can be given with "-p"; if any of
+ * these fail too many times in a row the child is killed, and hence
+ * restarted. Each probe is described by
+ *
+ *      <kind>,<interval>,<timeout>,<failures>[,<target>]
+ *
+ * where the probe is run every <interval> seconds, fails if it takes longer
+ * than <timeout> seconds, and kills the child after <failures> consecutive
+ * failures. The kinds are:
+ *
+ *      exec,...,<path>         run <path>, which should exit with status 0
+ *      unix,...,<path>         connect to the unix domain socket <path>
+ *      tcp,...,<host>:<port>   connect to the numeric address <host>:<port>
+ *      watchdog,...            the child must write to the fd given in
+ *                              $WATCHDOG_FD at least every <timeout> seconds
+ *
  * Author:  Alastair Hughes
  * Contact: hobbitalastair at yandex dot com
  */
 
+#include <limits.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -18,6 +35,8 @@
 #include <sys/socket.h>
 #include <sys/un.h>
 #include <sys/wait.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
 #include <time.h>
 #include <unistd.h>
 #include <fcntl.h>
@@ -81,6 +100,30 @@ sigset_t init_signals(char* name) {
     return mask;
 }
 
+int reset_signals(void) {
+    /* Restore the default signal handlers and mask in a forked child.
+     *
+     * The handlers need to be reset before unmasking, otherwise a pending
+     * SIGTERM would be swallowed by handle_signal() instead of killing the
+     * child.
+     *
+     * Returns -1 on failure.
+     */
+
+    struct sigaction action;
+    action.sa_handler = SIG_DFL;
+    action.sa_flags = 0;
+    int ret = sigemptyset(&action.sa_mask);
+    if (ret != -1) ret = sigaction(SIGCHLD, &action, NULL);
+    if (ret != -1) ret = sigaction(SIGALRM, &action, NULL);
+    if (ret != -1) ret = sigaction(SIGTERM, &action, NULL);
+
+    sigset_t child_mask;
+    if (ret != -1) ret = sigemptyset(&child_mask);
+    if (ret != -1) ret = sigprocmask(SIG_SETMASK, &child_mask, NULL);
+    return ret;
+}
+
 int init_socket(char* name, char* path) {
     /* Initialise a local socket bound to "path", calling exit() on failure */
     if (strlen(path) >= SOCK_PATHLEN) {
@@ -145,13 +188,316 @@ void daemonize(char* name) {
     if (result > 0) exit(EXIT_SUCCESS);
 }
 
-pid_t launch(char* name, int sock, int count, char** args) {
-    /* Launch the child process described with args 2 and onwards.
+enum probe_kind {PROBE_EXEC, PROBE_UNIX, PROBE_TCP, PROBE_WATCHDOG};
+
+struct probe {
+    enum probe_kind kind;
+    char* spec; /* Original description, for logging */
+    char* target;
+    /* All times are in milliseconds, as given by now() */
+    long long interval;
+    long long timeout;
+    int threshold; /* Consecutive failures before killing the child */
+
+    int failures;
+    long long next; /* Time at which the next check should start */
+    long long deadline; /* Time at which a running check fails; 0 if idle */
+    pid_t pid; /* Running exec check */
+    int fd; /* Connecting socket, or the read end of the watchdog pipe */
+    long long last; /* Time of the last watchdog keepalive */
+
+    struct sockaddr_storage addr;
+    socklen_t addrlen;
+};
+
+long long now(void) {
+    /* Return the current monotonic time in milliseconds.
+     *
+     * This should never fail, as CLOCK_MONOTONIC is always supported.
+     */
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+}
+
+void parse_addr(char* name, struct probe* p) {
+    /* Resolve the target address of a connecting probe.
+     *
+     * Only numeric addresses are accepted for tcp probes, as looking up a
+     * name may block the event loop indefinitely.
+     * This calls exit() on failure.
+     */
+
+    if (p->kind == PROBE_UNIX) {
+        if (strlen(p->target) >= SOCK_PATHLEN) {
+            fprintf(stderr, "%s: \"%s\" too long (max %zu bytes)\n", name,
+                    p->target, strlen(p->target));
+            exit(EINVAL);
+        }
+        struct sockaddr_un* addr = (struct sockaddr_un*)(&p->addr);
+        addr->sun_family = AF_UNIX;
+        strcpy(addr->sun_path, p->target);
+        p->addrlen = strlen(p->target) + sizeof(addr->sun_family);
+        return;
+    }
+
+    char host[256];
+    char* port = strrchr(p->target, ':');
+    if (port == NULL) {
+        fprintf(stderr, "%s: expected <host>:<port>, got \"%s\"\n", name,
+                p->target);
+        exit(EINVAL);
+    }
+    size_t len = port - p->target;
+    if (len >= sizeof(host)) {
+        fprintf(stderr, "%s: \"%s\" too long\n", name, p->target);
+        exit(EINVAL);
+    }
+    port++;
+    /* Allow "[::1]:22" style IPv6 addresses */
+    if (len >= 2 && p->target[0] == '[' && p->target[len - 1] == ']') {
+        memcpy(host, p->target + 1, len - 2);
+        host[len - 2] = '\0';
+    } else {
+        memcpy(host, p->target, len);
+        host[len] = '\0';
+    }
+
+    char* end = NULL;
+    long value = strtol(port, &end, 10);
+    if (end == port || *end != '\0' || value <= 0 || value > 65535) {
+        fprintf(stderr, "%s: invalid port in \"%s\"\n", name, p->target);
+        exit(EINVAL);
+    }
+
+    /* Use inet_pton rather than getaddrinfo, which drags in the resolver */
+    struct sockaddr_in* addr4 = (struct sockaddr_in*)(&p->addr);
+    struct sockaddr_in6* addr6 = (struct sockaddr_in6*)(&p->addr);
+    if (inet_pton(AF_INET, host, &addr4->sin_addr) == 1) {
+        addr4->sin_family = AF_INET;
+        addr4->sin_port = htons(value);
+        p->addrlen = sizeof(struct sockaddr_in);
+    } else if (inet_pton(AF_INET6, host, &addr6->sin6_addr) == 1) {
+        addr6->sin6_family = AF_INET6;
+        addr6->sin6_port = htons(value);
+        p->addrlen = sizeof(struct sockaddr_in6);
+    } else {
+        fprintf(stderr, "%s: \"%s\" is not a numeric address\n", name,
+                host);
+        exit(EINVAL);
+    }
+}
+
+void parse_probe(char* name, char* spec, struct probe* p) {
+    /* Parse a probe description into the given probe.
+     *
+     * This calls exit() on failure.
+     */
+
+    memset(p, 0, sizeof(struct probe));
+    p->spec = spec;
+    p->fd = -1;
+
+    char* copy = strdup(spec);
+    if (copy == NULL) {
+        fprintf(stderr, "%s: strdup(): %s\n", name, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    /* The target is last so that it may contain commas */
+    char* fields[5] = {NULL};
+    char* rest = copy;
+    int i;
+    for (i = 0; i < 5 && rest != NULL; i++) {
+        fields[i] = rest;
+        rest = i < 4 ? strchr(rest, ',') : NULL;
+        if (rest != NULL) *rest++ = '\0';
+    }
+
+    long values[3];
+    for (i = 0; i < 3; i++) {
+        char* end = NULL;
+        values[i] = fields[i + 1] == NULL ? 0 :
+            strtol(fields[i + 1], &end, 10);
+        if (end == NULL || end == fields[i + 1] || *end != '\0' ||
+                values[i] <= 0 || values[i] > INT_MAX) {
+            fprintf(stderr, "%s: invalid probe \"%s\"\n", name, spec);
+            exit(EINVAL);
+        }
+    }
+    /* long may be 32 bits, so convert to milliseconds as long long */
+    p->interval = values[0] * 1000LL;
+    p->timeout = values[1] * 1000LL;
+    p->threshold = values[2];
+    p->target = fields[4];
+
+    if (strcmp(fields[0], "exec") == 0) {
+        p->kind = PROBE_EXEC;
+    } else if (strcmp(fields[0], "unix") == 0) {
+        p->kind = PROBE_UNIX;
+    } else if (strcmp(fields[0], "tcp") == 0) {
+        p->kind = PROBE_TCP;
+    } else if (strcmp(fields[0], "watchdog") == 0) {
+        p->kind = PROBE_WATCHDOG;
+    } else {
+        fprintf(stderr, "%s: unknown probe kind \"%s\"\n", name, fields[0]);
+        exit(EINVAL);
+    }
+
+    if ((p->kind == PROBE_WATCHDOG) != (p->target == NULL)) {
+        fprintf(stderr, "%s: invalid probe \"%s\"\n", name, spec);
+        exit(EINVAL);
+    }
+    if (p->kind == PROBE_UNIX || p->kind == PROBE_TCP) parse_addr(name, p);
+}
+
+void probe_stop(struct probe* p) {
+    /* Abandon any running check for the given probe.
+     *
+     * Exec checks run in their own process group, so that anything they
+     * spawned is killed with them.
+     */
+    if (p->pid > 0) kill(-p->pid, SIGKILL);
+    p->pid = 0;
+    if (p->kind != PROBE_WATCHDOG && p->fd != -1) {
+        close(p->fd);
+        p->fd = -1;
+    }
+    p->deadline = 0;
+}
+
+bool probe_result(char* name, struct probe* p, bool ok) {
+    /* Record the result of a check.
+     *
+     * Returns true if the probe has now failed too many times.
+     */
+
+    probe_stop(p);
+    p->next = now() + p->interval;
+    if (ok) {
+        p->failures = 0;
+        return false;
+    }
+
+    p->failures++;
+    fprintf(stderr, "%s: probe %s failed (%d/%d)\n", name, p->spec,
+            p->failures, p->threshold);
+    return p->failures >= p->threshold;
+}
+
+bool probe_start(char* name, struct probe* p, int sock) {
+    /* Start a check for the given probe, without blocking.
+     *
+     * Returns true if the probe has now failed too many times.
+     */
+
+    long long t = now();
+    p->deadline = t + p->timeout;
+
+    if (p->kind == PROBE_WATCHDOG) {
+        return probe_result(name, p, t - p->last <= p->timeout);
+    }
+
+    if (p->kind == PROBE_EXEC) {
+        pid_t pid = fork();
+        if (pid == -1) {
+            fprintf(stderr, "%s: fork(): %s\n", name, strerror(errno));
+            return probe_result(name, p, false);
+        }
+        if (pid == 0) {
+            close(sock);
+            setpgid(0, 0);
+            if (reset_signals() == -1) {
+                fprintf(stderr, "%s: resetting signals failed: %s\n", name,
+                        strerror(errno));
+                exit(EXIT_FAILURE);
+            }
+            execl(p->target, p->target, (char*)NULL);
+            fprintf(stderr, "%s: execl(): %s\n", name, strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+        /* Also set the group here, in case we kill it before the child runs */
+        setpgid(pid, pid);
+        p->pid = pid;
+        return false;
+    }
+
+    p->fd = socket(p->addr.ss_family, SOCK_STREAM, 0);
+    if (p->fd == -1) {
+        fprintf(stderr, "%s: socket(): %s\n", name, strerror(errno));
+        return probe_result(name, p, false);
+    }
+    if (fcntl(p->fd, F_SETFD, FD_CLOEXEC) == -1 ||
+            fcntl(p->fd, F_SETFL, O_NONBLOCK) == -1) {
+        fprintf(stderr, "%s: fcntl(): %s\n", name, strerror(errno));
+        return probe_result(name, p, false);
+    }
+    if (connect(p->fd, (struct sockaddr*)(&p->addr), p->addrlen) == 0) {
+        return probe_result(name, p, true);
+    }
+    /* Unix domain sockets return EAGAIN when the backlog is full, which
+     * means that the child is not accepting connections; treat this as a
+     * failure along with everything else.
+     */
+    if (errno != EINPROGRESS && errno != EINTR) {
+        return probe_result(name, p, false);
+    }
+    return false;
+}
+
+int probes_reset(char* name, struct probe* probes, int count) {
+    /* Reset the probes for a newly launched child.
+     *
+     * Returns the write end of the watchdog pipe to pass to the child, or -1
+     * if there is no watchdog.
+     */
+
+    int watchdog = -1;
+    long long t = now();
+    for (int i = 0; i < count; i++) {
+        struct probe* p = &probes[i];
+        probe_stop(p);
+        p->failures = 0;
+        p->next = t + p->interval;
+        p->last = t;
+
+        if (p->kind != PROBE_WATCHDOG) continue;
+        if (p->fd != -1) close(p->fd);
+        p->fd = -1;
+
+        int fds[2];
+        while (pipe(fds) == -1) {
+            fprintf(stderr, "%s: pipe(): %s\n", name, strerror(errno));
+            sleep(SLEEP_INTERVAL);
+        }
+        fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+        fcntl(fds[0], F_SETFL, O_NONBLOCK);
+        fcntl(fds[1], F_SETFD, FD_CLOEXEC);
+        p->fd = fds[0];
+        watchdog = fds[1];
+    }
+    return watchdog;
+}
+
+void probes_stop(struct probe* probes, int count) {
+    /* Stop all probes, including the watchdog */
+    for (int i = 0; i < count; i++) {
+        probe_stop(&probes[i]);
+        if (probes[i].fd != -1) close(probes[i].fd);
+        probes[i].fd = -1;
+        probes[i].next = 0;
+    }
+}
+
+pid_t launch(char* name, int sock, int watchdog, char** args) {
+    /* Launch the child process described by the NULL terminated args.
+     *
+     * If watchdog is not -1 it is passed to the child, and then closed.
      *
      * Returns the pid of the child.
      */
 
-    fprintf(stderr, "%s: launching child %s\n", name, args[2]);
+    fprintf(stderr, "%s: launching child %s\n", name, args[0]);
 
     pid_t pid = fork();
     while (pid == -1) {
@@ -163,47 +509,79 @@ pid_t launch(char* name, int sock, int count, char** args) {
     if (pid == 0) {
         /* Clean up */
         close(sock);
-        sigset_t child_mask;
-        int ret = sigemptyset(&child_mask);
-        if (ret != -1) ret = sigprocmask(SIG_SETMASK, &child_mask, NULL);
+        int ret = reset_signals();
         if (ret == -1) {
-            fprintf(stderr, "%s: setting the signal mask failed: %s\n", name,
+            fprintf(stderr, "%s: resetting signals failed: %s\n", name,
                     strerror(errno));
             exit(EXIT_FAILURE);
         }
 
-        /* Exec child */
-        size_t i;
-        for (i = 0; i < count - 2; i ++) {
-            args[i] = args[i + 2];
+        /* Pass the watchdog through to the child */
+        if (watchdog != -1) {
+            char buf[16];
+            snprintf(buf, sizeof(buf), "%d", watchdog);
+            ret = fcntl(watchdog, F_SETFD, 0);
+            if (ret != -1) ret = setenv(WATCHDOG_ENV, buf, 1);
+            if (ret == -1) {
+                fprintf(stderr, "%s: passing the watchdog failed: %s\n",
+                        name, strerror(errno));
+                exit(EXIT_FAILURE);
+            }
         }
-        args[i] = (char*)NULL;
+
+        /* Exec child */
         execv(args[0], args);
         fprintf(stderr, "%s: execv(): %s\n", name, strerror(errno));
         exit(EXIT_FAILURE);
     }
 
+    if (watchdog != -1) close(watchdog);
     return pid;
 }
 
 int main(int count, char** args) {
     char* name = __FILE__;
     if (count > 0) name = args[0];
-    if (count < 3) {
-        fprintf(stderr, "usage: %s <socket> [<child> ...]\n", name);
+
+    struct probe* probes = calloc(count, sizeof(struct probe));
+    if (probes == NULL) {
+        fprintf(stderr, "%s: calloc(): %s\n", name, strerror(errno));
+        return EXIT_FAILURE;
+    }
+    int probe_count = 0;
+    bool watchdog = false;
+    int opt = 0;
+    while (opt != '?' && (opt = getopt(count, args, "+p:")) != -1) {
+        if (opt != 'p') continue;
+        parse_probe(name, optarg, &probes[probe_count]);
+        if (probes[probe_count].kind == PROBE_WATCHDOG) {
+            if (watchdog) {
+                fprintf(stderr, "%s: only one watchdog is supported\n", name);
+                return EINVAL;
+            }
+            watchdog = true;
+        }
+        probe_count++;
+    }
+    if (opt == '?' || count - optind < 2) {
+        fprintf(stderr, "usage: %s [-p <probe>]... <socket> [<child> ...]\n",
+                name);
         return EINVAL;
     }
+    char* path = args[optind];
+    char** child_args = &args[optind + 1];
 
     sigset_t mask = init_signals(name);
-    int sock = init_socket(name, args[1]);
+    int sock = init_socket(name, path);
     daemonize(name);
 
     time_t launch_time = time(NULL);
-    pid_t pid = launch(name, sock, count, args);
+    int fd = probes_reset(name, probes, probe_count);
+    pid_t pid = launch(name, sock, fd, child_args);
 
     /* Main event loop.
      *
-     * We need to deal with signals and new connections here.
+     * We need to deal with signals, new connections, and probes here.
      * Key signals are SIGCHLD, SIGALRM, and SIGTERM.
      * We should never call exit() here; retry failures instead.
      */
@@ -222,19 +600,57 @@ int main(int count, char** args) {
          * use it as a pause() alternative when we have closed the socket.
          */
         fd_set fds;
+        fd_set wfds;
         FD_ZERO(&fds);
+        FD_ZERO(&wfds);
+        int nfds = sock + 1;
         if (sock != -1) FD_SET(sock, &fds);
-        if (pselect(sock + 1, &fds, NULL, NULL, NULL, &mask) == -1 &&
-                errno != EINTR) {
+
+        /* Wake up for the next probe which is due or times out */
+        long long t = now();
+        long long wake = 0;
+        for (int i = 0; i < probe_count; i++) {
+            struct probe* p = &probes[i];
+            if (p->next == 0) continue;
+            long long due = p->deadline != 0 ? p->deadline : p->next;
+            if (wake == 0 || due < wake) wake = due;
+
+            if (p->fd == -1) continue;
+            FD_SET(p->fd, p->kind == PROBE_WATCHDOG ? &fds : &wfds);
+            if (p->fd >= nfds) nfds = p->fd + 1;
+        }
+        long long delay = wake > t ? wake - t : 0;
+        struct timespec timeout = {
+            .tv_sec = delay / 1000,
+            .tv_nsec = (delay % 1000) * 1000000
+        };
+
+        int ready = pselect(nfds, &fds, &wfds, NULL,
+                wake != 0 ? &timeout : NULL, &mask);
+        if (ready == -1 && errno != EINTR) {
             fprintf(stderr, "%s: pselect(): %s\n", name, strerror(errno));
             sleep(SLEEP_INTERVAL);
         }
+        if (ready == -1) {
+            /* The fd sets are undefined after an error */
+            FD_ZERO(&fds);
+            FD_ZERO(&wfds);
+        }
 
+        bool probe_failed = false;
         pid_t child = 1;
         while (child > 0) {
             int status;
             child = waitpid(-1, &status, WNOHANG);
 
+            for (int i = 0; child > 0 && i < probe_count; i++) {
+                struct probe* p = &probes[i];
+                if (p->kind != PROBE_EXEC || p->pid != child) continue;
+                p->pid = 0;
+                bool ok = WIFEXITED(status) && WEXITSTATUS(status) == 0;
+                if (probe_result(name, p, ok)) probe_failed = true;
+            }
+
             if (child == pid) {
                 /* Handle our special child */
                 if (WIFEXITED(status)) {
@@ -253,7 +669,10 @@ int main(int count, char** args) {
                     }
                     launch_time = time(NULL);
 
-                    pid = launch(name, sock, count, args);
+                    /* Any failures belonged to the old child */
+                    probe_failed = false;
+                    int fd = probes_reset(name, probes, probe_count);
+                    pid = launch(name, sock, fd, child_args);
                 } else {
                     if (conn != -1) {
                         /* We write a single byte to the buffer to confirm that
@@ -288,6 +707,46 @@ int main(int count, char** args) {
             }
         }
 
+        for (int i = 0; keep_alive && i < probe_count; i++) {
+            struct probe* p = &probes[i];
+            if (p->fd != -1 && FD_ISSET(p->fd, &fds)) {
+                /* Drain the watchdog; EOF means the child closed it, in
+                 * which case the keepalives stop and the probe fails.
+                 */
+                char buf[64];
+                ssize_t len;
+                while ((len = read(p->fd, buf, sizeof(buf))) > 0) {
+                    p->last = now();
+                }
+                if (len == 0) {
+                    close(p->fd);
+                    p->fd = -1;
+                }
+            } else if (p->fd != -1 && FD_ISSET(p->fd, &wfds)) {
+                int err = 0;
+                socklen_t len = sizeof(err);
+                getsockopt(p->fd, SOL_SOCKET, SO_ERROR, &err, &len);
+                if (probe_result(name, p, err == 0)) probe_failed = true;
+            }
+
+            t = now();
+            if (p->deadline != 0 && t >= p->deadline) {
+                fprintf(stderr, "%s: probe %s timed out\n", name, p->spec);
+                if (probe_result(name, p, false)) probe_failed = true;
+            } else if (p->deadline == 0 && p->next != 0 && t >= p->next) {
+                if (probe_start(name, p, sock)) probe_failed = true;
+            }
+        }
+
+        if (keep_alive && probe_failed) {
+            /* The child is presumably hung, so there is little point in
+             * asking nicely; it will be restarted when we reap it.
+             */
+            fprintf(stderr, "%s: killing unhealthy child\n", name);
+            probes_stop(probes, probe_count);
+            kill(pid, SIGKILL);
+        }
+
         if (sigalrm) {
             /* Kill the child */
             fprintf(stderr, "%s: killing child\n", name);
@@ -301,9 +760,10 @@ int main(int count, char** args) {
             quit_request = sigterm = 0;
 
             keep_alive = false;
+            probes_stop(probes, probe_count);
             kill(pid, SIGTERM);
 
-            unlink(args[1]);
+            unlink(path);
             close(sock);
             sock = -1;
 
@@ -0,0 +1,104 @@
+#!/usr/bin/sh
+#
+# footprint.sh: report the size and idle RSS of the helper binaries.
+#
+# For each given directory, print the file size of connect, escort, semaphore
+# and state along with their resident memory while blocked:
+#
+# - escort while looking after a sleeping child;
+# - connect while waiting for an escort to stop a child ignoring SIGTERM;
+# - semaphore and state while waiting to read a FIFO.
+#
+# The RSS is read from /proc, so this only works on Linux.
+#
+# Author:   Alastair Hughes
+# Contact:  hobbitalastair at yandex dot com
+
+PROGS="connect escort semaphore state"
+
+if [ $# = 0 ]; then
+    printf "usage: footprint.sh <dir> [<dir> ...]\n" 1>&2
+    exit 1
+fi
+
+work="$(mktemp -d "${TMPDIR:-/tmp}/bh-footprint.XXXXXX")"
+if [ "$?" != 0 ]; then
+    printf '%s: failed to create a temporary dir\n' "$0" 1>&2
+    exit 1
+fi
+cleanup() {
+    # Escorts stop their child on SIGTERM (or SIGKILL after CHILD_TIMEOUT), so
+    # this also removes the children.
+    pkill -TERM -f "escort ${work}/" 2> /dev/null
+    rm -rf "${work}"
+}
+trap cleanup EXIT
+trap 'exit 1' INT TERM
+
+rss() {
+    # Print the resident memory of the given pid in kB.
+    awk '/^VmRSS:/ { print $2 }' "/proc/$1/status" 2> /dev/null
+}
+
+settle() {
+    # Give the process being measured time to reach its idle state.
+    sleep 0.2
+}
+
+measure() {
+    # Print the idle RSS of the given binary.
+    prog="$1"
+    name="$(basename "${prog}")"
+    case "${name}" in
+        escort)
+            "${prog}" "${work}/escort" /bin/sleep 60 2> /dev/null
+            settle
+            pid="$(pgrep -f "escort ${work}/escort ")"
+            rss "${pid}"
+            kill "${pid}" 2> /dev/null
+            ;;
+        connect)
+            # The child ignores SIGTERM, so connect waits for CHILD_TIMEOUT
+            # unless we kill the child ourselves.
+            "${escort_prog}" "${work}/connect" /bin/sh -c \
+                "trap '' TERM; exec sleep 60" 2> /dev/null
+            settle
+            escort="$(pgrep -f "escort ${work}/connect ")"
+            "${prog}" "${work}/connect" &
+            pid="$!"
+            settle
+            rss "${pid}"
+            pkill -KILL -P "${escort}"
+            wait "${pid}"
+            ;;
+        semaphore|state)
+            mkfifo "${work}/fifo"
+            if [ "${name}" = semaphore ]; then
+                "${prog}" "${work}/fifo" + &
+            else
+                "${prog}" "${work}/fifo" started &
+            fi
+            pid="$!"
+            settle
+            rss "${pid}"
+            kill "${pid}"
+            wait "${pid}" 2> /dev/null
+            rm -f "${work}/fifo"
+            ;;
+    esac
+}
+
+printf '%-24s %12s %12s\n' "binary" "size (B)" "idle rss (kB)"
+for dir in "$@"; do
+    # connect needs an escort to talk to; use the one being measured.
+    escort_prog="$(cd "${dir}" && pwd)/escort"
+    for prog in ${PROGS}; do
+        path="$(cd "${dir}" && pwd)/${prog}"
+        if [ ! -x "${path}" ]; then
+            printf '%s: %s not found\n' "$0" "${dir}/${prog}" 1>&2
+            exit 1
+        fi
+        printf '%-24s %12s %12s\n' "${dir}/${prog}" \
+            "$(wc -c < "${path}")" "$(measure "${path}")"
+    done
+done
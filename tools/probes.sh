@@ -0,0 +1,137 @@
+#!/usr/bin/sh
+#
+# probes.sh: check that escort restarts children which fail their probes.
+#
+# An escort is run against a hanging child for each kind of probe, with a
+# probe which always fails, along with an exec check which always times out.
+# Each escort should kill the child as unhealthy and then relaunch it.
+# A further escort with a working watchdog should leave its child alone.
+# Finally the escorts are stopped, and no processes should be left behind.
+#
+# The programs under test are taken from PROBES_BINDIR (by default the
+# directory containing the makefile), so run "make" first.
+#
+# Author:   Alastair Hughes
+# Contact:  hobbitalastair at yandex dot com
+
+[ -z "${PROBES_BINDIR}" ] && PROBES_BINDIR="$(dirname "$0")/.."
+PROBES_WAIT=200 # Tenths of a second to wait; allows for CHILD_RATELIMIT
+
+if [ $# != 0 ]; then
+    printf "usage: probes.sh\n" 1>&2
+    exit 1
+fi
+
+PROBES_BINDIR="$(cd "${PROBES_BINDIR}" && pwd)"
+for prog in connect escort; do
+    if [ ! -x "${PROBES_BINDIR}/${prog}" ]; then
+        printf '%s: %s not found in %s; run make first\n' "$0" "${prog}" \
+            "${PROBES_BINDIR}" 1>&2
+        exit 1
+    fi
+done
+
+work="$(mktemp -d "${TMPDIR:-/tmp}/bh-probes.XXXXXX")"
+if [ "$?" != 0 ]; then
+    printf '%s: failed to create a temporary dir\n' "$0" 1>&2
+    exit 1
+fi
+
+leftovers() {
+    # Print any processes started from the temporary dir.
+    ps -eo pid,args | grep -F "${work}/" | grep -v grep
+}
+
+cleanup() {
+    # Escorts stop their child on SIGTERM, so this also removes the children.
+    leftovers | while read -r pid args; do
+        kill "${pid}" 2> /dev/null
+    done
+    rm -rf "${work}"
+}
+trap cleanup EXIT
+trap 'exit 1' INT TERM
+
+# The child hangs without ever answering a probe, while the exec check hangs
+# in a grandchild, which needs to be killed along with the check.
+# Neither uses exec, so that they show up in leftovers() if not killed.
+printf '#!/bin/sh\nwhile :; do sleep 1; done\n' > "${work}/child"
+printf '#!/bin/sh\n%s/child\n' "${work}" > "${work}/hang"
+printf '#!/bin/sh\nwhile :; do echo > /proc/self/fd/$%s; sleep 1; done\n' \
+    WATCHDOG_FD > "${work}/alive"
+chmod +x "${work}/child" "${work}/hang" "${work}/alive"
+
+# Each case is "<name> <probe> <child>"; the probe spec cannot contain spaces.
+cases="exec exec,1,1,2,/bin/false child
+timeout exec,1,1,2,${work}/hang child
+unix unix,1,1,2,${work}/missing child
+tcp tcp,1,1,2,127.0.0.1:1 child
+watchdog watchdog,1,1,2 child
+healthy watchdog,1,3,1 alive"
+
+printf '%s\n' "${cases}" | while read -r name probe child; do
+    "${PROBES_BINDIR}/escort" -p "${probe}" "${work}/${name}.sock" \
+        "${work}/${child}" 2> "${work}/${name}.log"
+done
+
+launches() {
+    grep -c 'launching child' "${work}/$1.log"
+}
+
+# Wait for every failing case to be relaunched.
+tries=0
+while [ "${tries}" -lt "${PROBES_WAIT}" ]; do
+    finished=1
+    for name in exec timeout unix tcp watchdog; do
+        [ "$(launches "${name}")" -lt 2 ] && finished=0
+    done
+    [ "${finished}" = 1 ] && break
+    sleep 0.1
+    tries=$((tries + 1))
+done
+
+failed=0
+printf '%s\n' "${cases}" | while read -r name probe child; do
+    # The kill needs to come between the first and second launch.
+    sequence="$(awk '
+        /launching child/ {
+            if (state == 0) state = 1;
+            else if (state == 2) state = 3;
+        }
+        /killing unhealthy child/ { if (state == 1) state = 2 }
+        END { print state + 0 }' "${work}/${name}.log")"
+    if [ "${name}" = healthy ]; then
+        if grep -q 'unhealthy' "${work}/${name}.log"; then
+            printf 'FAIL: %s: child was killed\n' "${name}"
+            cat "${work}/${name}.log"
+            exit 1
+        fi
+    elif [ "${sequence}" != 3 ]; then
+        printf 'FAIL: %s: child was not killed and relaunched\n' "${name}"
+        cat "${work}/${name}.log"
+        exit 1
+    fi
+    printf 'ok: %s\n' "${name}"
+done || failed=1
+
+for name in exec timeout unix tcp watchdog healthy; do
+    "${PROBES_BINDIR}/connect" "${work}/${name}.sock"
+done
+
+# Give the escorts time to stop their children and exit.
+tries=0
+while [ -n "$(leftovers)" ] && \
+        [ "${tries}" -lt 20 ]; do
+    sleep 0.1
+    tries=$((tries + 1))
+done
+if [ -n "$(leftovers)" ]; then
+    printf 'FAIL: processes left behind:\n'
+    leftovers
+    failed=1
+fi
+
+if [ "${failed}" != 0 ]; then
+    exit 1
+fi
+printf 'all probes behaved\n'
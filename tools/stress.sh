@@ -0,0 +1,243 @@
+#!/usr/bin/sh
+#
+# stress.sh: run many interleaved operations against a sandboxed rundir.
+#
+# A number of parallel clients each run a random sequence of require, release,
+# start, stop and stopall operations against a small set of dummy services.
+# Once the clients have finished the following invariants are checked:
+#
+# - the stored require count of each service equals the number of requires
+#   still held by the clients;
+# - after a final bh-stopall, no escort processes are left running;
+# - after a final bh-stopall, no sockets are left in the rundir.
+#
+# The throughput of each operation is reported, and the exit status is
+# non-zero if any invariant was violated.
+#
+# Note that this currently fails the require count check, due to the known
+# race from semaphore and state using F_RDLCK, which does not exclude other
+# writers.
+#
+# The programs under test are taken from STRESS_BINDIR (by default the
+# directory containing the makefile), so run "make" first.
+#
+# Author:   Alastair Hughes
+# Contact:  hobbitalastair at yandex dot com
+
+[ -z "${STRESS_BINDIR}" ] && STRESS_BINDIR="$(dirname "$0")/.."
+[ -z "${STRESS_CLIENTS}" ] && STRESS_CLIENTS=16
+[ -z "${STRESS_OPS}" ] && STRESS_OPS=200 # Per client
+[ -z "${STRESS_SERVICES}" ] && STRESS_SERVICES=4
+[ -z "${STRESS_SEED}" ] && STRESS_SEED="$(date +%s)"
+STRESS_SETTLE=50 # Tenths of a second to wait for escorts to exit
+
+if [ $# != 0 ]; then
+    printf "usage: stress.sh\n" 1>&2
+    exit 1
+fi
+
+STRESS_BINDIR="$(cd "${STRESS_BINDIR}" && pwd)"
+for prog in bh-release bh-require bh-start bh-stop bh-stopall \
+        connect escort semaphore state; do
+    if [ ! -x "${STRESS_BINDIR}/${prog}" ]; then
+        printf '%s: %s not found in %s; run make first\n' "$0" "${prog}" \
+            "${STRESS_BINDIR}" 1>&2
+        exit 1
+    fi
+done
+PATH="${STRESS_BINDIR}:${PATH}"
+
+# The rundir needs to be short enough that the sockets fit in SOCK_PATHLEN.
+work="$(mktemp -d "${TMPDIR:-/tmp}/bh-stress.XXXXXX")"
+if [ "$?" != 0 ]; then
+    printf '%s: failed to create the sandbox\n' "$0" 1>&2
+    exit 1
+fi
+export SERVICE_DIR="${work}/services"
+export SERVICE_RUNDIR="${work}/run"
+export SERVICE_LOGDIR="${work}/log"
+mkdir -p "${SERVICE_DIR}" "${SERVICE_RUNDIR}" "${SERVICE_LOGDIR}" \
+    "${work}/clients"
+
+cleanup() {
+    # Escorts stop their child on SIGTERM, so this also removes the services.
+    pkill -TERM -f "^escort ${SERVICE_RUNDIR}/" 2> /dev/null
+    rm -rf "${work}"
+}
+trap cleanup EXIT
+trap 'exit 1' INT TERM
+
+i=0
+while [ "${i}" -lt "${STRESS_SERVICES}" ]; do
+    dir="${SERVICE_DIR}/svc${i}"
+    mkdir -p "${dir}"
+    printf '#!/bin/sh\nexit 0\n' > "${dir}/pre"
+    printf '#!/bin/sh\nexec sleep 3600\n' > "${dir}/run"
+    printf '#!/bin/sh\nexit 0\n' > "${dir}/post"
+    chmod +x "${dir}/pre" "${dir}/run" "${dir}/post"
+    i=$((i + 1))
+done
+
+now() {
+    # Print the current time in nanoseconds.
+    # Busybox date does not support %N, in which case this degrades to
+    # second resolution.
+    t="$(date +%s%N)"
+    case "${t}" in
+        *N) printf '%s000000000\n' "${t%N}";;
+        *) printf '%s\n' "${t}";;
+    esac
+}
+
+client() {
+    # Run a random sequence of operations, recording "<op> <ns> <status>" for
+    # each in the client's log and the requires still held on exit.
+    id="$1"
+    log="${work}/clients/${id}.ops"
+    held="${work}/clients/${id}.held"
+
+    i=0
+    while [ "${i}" -lt "${STRESS_SERVICES}" ]; do
+        eval "held_${i}=0"
+        i=$((i + 1))
+    done
+
+    awk -v seed="$((STRESS_SEED + id))" -v ops="${STRESS_OPS}" \
+            -v services="${STRESS_SERVICES}" 'BEGIN {
+        srand(seed);
+        for (i = 0; i < ops; i++) {
+            r = rand();
+            if (r < 0.35) op = "require";
+            else if (r < 0.70) op = "release";
+            else if (r < 0.84) op = "start";
+            else if (r < 0.98) op = "stop";
+            else op = "stopall";
+            print op, int(rand() * services);
+        }
+    }' | while read -r op svc; do
+        eval "count=\${held_${svc}}"
+        if [ "${op}" = "release" ] && [ "${count}" = 0 ]; then
+            # Only release what this client required.
+            op="require"
+        fi
+
+        start="$(now)"
+        case "${op}" in
+            stopall) err="$(bh-stopall 2>&1 > /dev/null)";;
+            *) err="$(bh-${op} "svc${svc}" 2>&1 > /dev/null)";;
+        esac
+        ret="$?"
+        end="$(now)"
+        printf '%s %s %s\n' "${op}" "$((end - start))" "${ret}" >> "${log}"
+        if [ "${ret}" != 0 ]; then
+            printf 'client %s: %s svc%s: %s\n' "${id}" "${op}" "${svc}" \
+                "${err}" >> "${work}/errors"
+        fi
+
+        # A failure to start or stop after updating the count still leaves
+        # the count updated, so only the semaphore failing is not counted.
+        case "${err}" in
+            *"require count"*) ;;
+            *)
+                if [ "${op}" = "require" ]; then
+                    eval "held_${svc}=$((count + 1))"
+                elif [ "${op}" = "release" ]; then
+                    eval "held_${svc}=$((count - 1))"
+                fi
+                ;;
+        esac
+
+        # The pipeline runs in a subshell, so save the counts as we go.
+        i=0
+        : > "${held}"
+        while [ "${i}" -lt "${STRESS_SERVICES}" ]; do
+            eval "printf '%s %s\n' \"svc${i}\" \"\${held_${i}}\"" >> "${held}"
+            i=$((i + 1))
+        done
+    done
+}
+
+printf 'seed %s: %s clients x %s operations on %s services\n' \
+    "${STRESS_SEED}" "${STRESS_CLIENTS}" "${STRESS_OPS}" "${STRESS_SERVICES}"
+
+wall_start="$(now)"
+id=0
+while [ "${id}" -lt "${STRESS_CLIENTS}" ]; do
+    client "${id}" &
+    id=$((id + 1))
+done
+wait
+wall_end="$(now)"
+
+failed=0
+
+# Check that the require counts match the requires held by the clients.
+i=0
+while [ "${i}" -lt "${STRESS_SERVICES}" ]; do
+    expected="$(cat "${work}/clients/"*.held 2> /dev/null | \
+        awk -v svc="svc${i}" '$1 == svc { n += $2 } END { print n + 0 }')"
+    actual=0
+    require="${SERVICE_RUNDIR}/svc${i}/require"
+    if [ -s "${require}" ]; then
+        actual="$(cat "${require}")"
+    fi
+    if [ "${actual}" != "${expected}" ]; then
+        printf 'FAIL: svc%s require count is %s, %s requirers held\n' \
+            "${i}" "${actual}" "${expected}"
+        failed=1
+    fi
+    i=$((i + 1))
+done
+
+# Stop everything and check that nothing is left behind.
+bh-stopall > /dev/null 2>&1
+tries=0
+while pgrep -f "^escort ${SERVICE_RUNDIR}/" > /dev/null && \
+        [ "${tries}" -lt "${STRESS_SETTLE}" ]; do
+    sleep 0.1
+    tries=$((tries + 1))
+done
+
+orphans="$(pgrep -f "^escort ${SERVICE_RUNDIR}/" | wc -l)"
+if [ "${orphans}" != 0 ]; then
+    printf 'FAIL: %s orphan escorts after bh-stopall\n' "${orphans}"
+    failed=1
+fi
+
+sockets="$(find "${SERVICE_RUNDIR}" -type s | wc -l)"
+if [ "${sockets}" != 0 ]; then
+    printf 'FAIL: %s leftover sockets after bh-stopall\n' "${sockets}"
+    failed=1
+fi
+
+if [ -s "${work}/errors" ]; then
+    printf '%s operations failed, first few:\n' \
+        "$(wc -l < "${work}/errors")"
+    head -n 5 "${work}/errors"
+fi
+
+# Report the per-operation throughput.
+# Each client runs its operations serially, so "per client" is the rate a
+# single caller sees, while the total is across all of the clients.
+cat "${work}/clients/"*.ops | awk -v wall="$((wall_end - wall_start))" '
+    {
+        n[$1]++;
+        ns[$1] += $2;
+        if ($3 != 0) err[$1]++;
+        total++;
+    }
+    END {
+        printf "%-8s %8s %8s %12s %12s\n", "op", "count", "failed",
+               "mean ms", "per client/s";
+        for (op in n) {
+            printf "%-8s %8d %8d %12.2f %12.2f\n", op, n[op], err[op],
+                   ns[op] / n[op] / 1e6, ns[op] ? n[op] * 1e9 / ns[op] : 0;
+        }
+        printf "total %d operations in %.2fs (%.2f/s)\n", total, wall / 1e9,
+               wall ? total * 1e9 / wall : 0;
+    }'
+
+if [ "${failed}" != 0 ]; then
+    exit 1
+fi
+printf 'all invariants held\n'